@@ -0,0 +1,230 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <deque>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Soak test for connection reclamation: shows whether the server's memory, descriptors and
+// threads stay flat under hours of connection churn.
+//
+// Usage: ./churn_bench [server binary] [seconds] [population] [sample seconds]
+// Defaults to ./server, 3600 seconds, 1000 connections and a sample every 60 seconds. Every
+// second 5% of the connections are replaced. Half of those close normally. The other half
+// vanish without a FIN or RST, like a peer that lost power: TCP_REPAIR lets close() drop the
+// socket silently (this needs CAP_NET_ADMIN; without it the bench falls back to an RST). One
+// connection also posts a chat message each second, so the room keeps broadcasting to everyone.
+
+class ChurnBench {
+private:
+    int port = 12342;
+    const char* serverIp = "127.0.0.1";
+    pid_t serverPid = -1;
+    std::deque<int> sockets; // Oldest first
+    bool silentCloseWorks = true;
+    size_t vanished = 0;
+    size_t closed = 0;
+
+public:
+    ~ChurnBench() {
+        for (int socket : sockets) {
+            close(socket);
+        }
+        if (serverPid > 0) {
+            kill(serverPid, SIGTERM);
+            waitpid(serverPid, nullptr, 0);
+        }
+    }
+
+    bool startServer(const std::string& serverPath) {
+        serverPid = fork();
+        if (serverPid == -1) {
+            perror("fork failed");
+            return false;
+        }
+        if (serverPid == 0) {
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            execl(serverPath.c_str(), serverPath.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        for (int attempt = 0; attempt < 50; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            int probe = connectToServer();
+            if (probe != -1) {
+                close(probe);
+                return true;
+            }
+        }
+        std::cerr << "Server at " << serverPath << " did not start listening on port " << port << std::endl;
+        return false;
+    }
+
+    int connectToServer() const {
+        int clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (clientSocket == -1) {
+            return -1;
+        }
+        struct sockaddr_in serverAddr{};
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(port);
+        inet_pton(AF_INET, serverIp, &(serverAddr.sin_addr));
+        if (connect(clientSocket, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof(serverAddr)) == -1) {
+            close(clientSocket);
+            return -1;
+        }
+        return clientSocket;
+    }
+
+    // Opens connections until `population` are in the room. Name and room go out in two passes
+    // because the server reads each handshake step as one message.
+    void refill(size_t population) {
+        size_t first = sockets.size();
+        while (sockets.size() < population) {
+            int clientSocket = connectToServer();
+            if (clientSocket == -1) {
+                std::cerr << "Connect failed: " << strerror(errno) << std::endl;
+                break;
+            }
+            send(clientSocket, "churn", 5, MSG_NOSIGNAL);
+            sockets.push_back(clientSocket);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for (size_t i = first; i < sockets.size(); ++i) {
+            send(sockets[i], "soak", 4, MSG_NOSIGNAL);
+        }
+    }
+
+    // Replaces the oldest `count` connections, alternating between an orderly close and a peer
+    // that disappears without telling anyone.
+    void retire(size_t count) {
+        for (size_t i = 0; i < count && !sockets.empty(); ++i) {
+            int clientSocket = sockets.front();
+            sockets.pop_front();
+            if (i % 2 == 0) {
+                vanish(clientSocket);
+            } else {
+                close(clientSocket);
+                ++closed;
+            }
+        }
+    }
+
+    void chat(size_t tick) {
+        if (sockets.empty()) {
+            return;
+        }
+        std::string message = "churn message " + std::to_string(tick);
+        send(sockets[tick % sockets.size()], message.c_str(), message.size(), MSG_NOSIGNAL);
+    }
+
+    void sample(long seconds, long& residentBytes, size_t& descriptors) const {
+        residentBytes = statusField("VmRSS:") * 1024;
+        long threads = statusField("Threads:");
+        descriptors = 0;
+        std::error_code error;
+        for (auto it = std::filesystem::directory_iterator("/proc/" + std::to_string(serverPid) + "/fd", error);
+             !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+            ++descriptors;
+        }
+        std::printf("t=%lds connections=%zu closed=%zu vanished=%zu rss_bytes=%ld fds=%zu threads=%ld\n",
+                    seconds, sockets.size(), closed, vanished, residentBytes, descriptors, threads);
+        std::fflush(stdout);
+    }
+
+private:
+    void vanish(int clientSocket) {
+        int repair = 1;
+        if (silentCloseWorks && setsockopt(clientSocket, IPPROTO_TCP, TCP_REPAIR, &repair, sizeof(repair)) == -1) {
+            std::cerr << "TCP_REPAIR unavailable (" << strerror(errno) << "); vanishing peers will send an RST instead" << std::endl;
+            silentCloseWorks = false;
+        }
+        if (!silentCloseWorks) {
+            struct linger abort{1, 0};
+            setsockopt(clientSocket, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+        }
+        close(clientSocket);
+        ++vanished;
+    }
+
+    long statusField(const char* field) const {
+        std::ifstream status("/proc/" + std::to_string(serverPid) + "/status");
+        std::string line;
+        size_t length = strlen(field);
+        while (std::getline(status, line)) {
+            if (line.compare(0, length, field) == 0) {
+                std::istringstream fields(line.substr(length));
+                long value = 0;
+                fields >> value;
+                return value;
+            }
+        }
+        return -1;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+
+    std::string serverPath = argc > 1 ? argv[1] : "./server";
+    long seconds = argc > 2 ? std::atol(argv[2]) : 3600;
+    size_t population = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000;
+    long sampleSeconds = argc > 4 ? std::atol(argv[4]) : 60;
+    size_t churnPerSecond = std::max<size_t>(2, population / 20);
+    long warmUpSeconds = std::min(seconds / 2, 120L); // Long enough for vanished peers to start being reaped
+
+    ChurnBench bench;
+    if (!bench.startServer(serverPath)) {
+        return 1;
+    }
+    bench.refill(population);
+
+    long baselineBytes = -1;
+    size_t baselineDescriptors = 0;
+    long residentBytes = 0;
+    size_t descriptors = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long tick = 1; tick <= seconds; ++tick) {
+        std::this_thread::sleep_until(start + std::chrono::seconds(tick));
+        bench.retire(churnPerSecond);
+        bench.refill(population);
+        bench.chat(static_cast<size_t>(tick));
+
+        if (tick % sampleSeconds == 0 || tick == seconds) {
+            bench.sample(tick, residentBytes, descriptors);
+            if (baselineBytes < 0 && tick >= warmUpSeconds) {
+                baselineBytes = residentBytes;
+                baselineDescriptors = descriptors;
+            }
+        }
+    }
+
+    if (baselineBytes >= 0) {
+        std::printf("rss_growth_bytes=%ld fd_growth=%ld\n", residentBytes - baselineBytes,
+                    static_cast<long>(descriptors) - static_cast<long>(baselineDescriptors));
+    }
+    return 0;
+}
@@ -4,6 +4,11 @@
 #include <arpa/inet.h>
 #include <thread>
 #include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
 
 using namespace std;
 
@@ -16,6 +21,11 @@ private:
     int clientSocket;
     struct sockaddr_in serverAddr;
     std::thread receiveThread;
+    std::atomic<int> lastSeenId{-1}; // Newest messageId received in the current room
+    string currentRoom;
+    bool skippingMessage = false; // The message being received is a replay that is not shown
+    std::string partialTag; // Start of a message whose "#<messageId> " tag is still arriving
+    std::mutex receiveMutex; // One receive thread reads at a time, so the stream is parsed in order
 
 public:
     Client() {
@@ -43,13 +53,21 @@ public:
     }
 
     void receiveServerMessage() {
+        std::lock_guard<std::mutex> receiveLock(receiveMutex);
         char buffer[1024];
-        memset(buffer, 0, sizeof(buffer));
+        std::string message;
+        ssize_t bytesReceived;
+        do { // Reads that leave nothing to show (heartbeats, replays, part of a tag) are skipped
+            bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
+            if (bytesReceived > 0) {
+                message.assign(buffer, bytesReceived);
+                message.erase(std::remove(message.begin(), message.end(), '\x05'), message.end());
+                trackMessageIds(message);
+            }
+        } while (bytesReceived > 0 && message.empty());
 
-        ssize_t bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
         if (bytesReceived > 0) {
             std::lock_guard<std::mutex> lock(io_mutex);
-            std::string message(buffer, bytesReceived);
 
             if (message.find("receive") != std::string::npos) {
                 size_t startPos = message.find("wants to send ") + std::string("wants to send ").length();
@@ -76,6 +94,84 @@ public:
         }
     }
 
+    // Strips the "#<messageId> " tag that starts every server message and remembers the newest id.
+    // A message starts at "\n"; the server keeps peer text on one line, so tags cannot be forged.
+    // A message at or below the newest id is a replay of something already shown and is removed,
+    // including any part of it that arrives in a later read. TCP does not keep the server's
+    // message boundaries, so a tag cut off at the end of a read is held back for the next one.
+    void trackMessageIds(std::string& message) {
+        message.insert(0, partialTag);
+        partialTag.clear();
+        std::string shown;
+        size_t start = 0;
+        while (start < message.size()) {
+            if (message[start] == '\n' && isPartialTag(message, start)) {
+                partialTag = message.substr(start);
+                break;
+            }
+            size_t end = message.find('\n', start + 1);
+            if (end == std::string::npos) {
+                end = message.size();
+            }
+            size_t contentStart = start; // Text before the first "\n" continues the previous message
+            if (message[start] == '\n') {
+                int id = messageIdAt(message, start, contentStart);
+                if (id < 0) {
+                    skippingMessage = false; // Untagged, e.g. a server notice
+                } else if (id <= lastSeenId) {
+                    skippingMessage = true;
+                } else {
+                    skippingMessage = false;
+                    lastSeenId = id;
+                    shown += '\n';
+                }
+            }
+            if (!skippingMessage) {
+                shown.append(message, contentStart, end - contentStart);
+            }
+            start = end;
+        }
+        message.swap(shown);
+    }
+
+    // True if everything from `start` to the end could still become a "\n#<messageId> " tag.
+    static bool isPartialTag(const std::string& message, size_t start) {
+        size_t hash = start + 1;
+        if (hash == message.size()) {
+            return true;
+        }
+        if (message[hash] != '#') {
+            return false;
+        }
+        size_t end = hash + 1;
+        while (end < message.size() && isdigit(static_cast<unsigned char>(message[end]))) {
+            ++end;
+        }
+        return end == message.size() && end - (hash + 1) <= 10;
+    }
+
+    // Returns the id in a "\n#<messageId> " tag at `start` and sets contentStart past it, or
+    // returns -1 if there is no valid tag there.
+    static int messageIdAt(const std::string& message, size_t start, size_t& contentStart) {
+        size_t digits = start + 2;
+        if (message.compare(start, 2, "\n#") != 0) {
+            return -1;
+        }
+        size_t end = digits;
+        while (end < message.size() && end - digits < 10 && isdigit(static_cast<unsigned char>(message[end]))) {
+            ++end;
+        }
+        if (end == digits || end >= message.size() || message[end] != ' ') {
+            return -1;
+        }
+        long id = std::strtol(message.c_str() + digits, nullptr, 10);
+        if (id > INT_MAX) {
+            return -1;
+        }
+        contentStart = end + 1;
+        return static_cast<int>(id);
+    }
+
     void sendClientName() const {
         string clientName;
         cout << "\033[1;35m";
@@ -85,13 +181,17 @@ public:
         send(clientSocket, clientName.c_str(), clientName.size(), 0);
     }
 
-    void chooseRoom() const {
+    void chooseRoom() {
         string roomName;
         cout << "\033[1;35m";
         cout << "Enter room name: ";
         cout << "\033[0m";
         getline(cin, roomName);
         send(clientSocket, roomName.c_str(), roomName.size(), 0);
+        if (roomName != currentRoom) {
+            lastSeenId = -1; // Ids are counted per room
+            currentRoom = roomName;
+        }
     }
 
 
@@ -109,6 +209,9 @@ public:
             cout << "Enter the message: ";
             getline(std::cin, message);
             if (message.find("REJOIN") == 0) {
+                if (message == "REJOIN" && lastSeenId >= 0) {
+                    message += " " + std::to_string(lastSeenId.load()); // Ask for only what we have not seen
+                }
                 send(clientSocket, message.c_str(), message.size(), 0);
                 sendClientName();
                 chooseRoom();
@@ -0,0 +1,327 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+// Checks delta sync for clients that flap while a room is under load.
+//
+// Usage: ./flap_test [server binary] [seconds] [flappers]
+// Defaults to ./server, 60 seconds and 20 flapping clients. A sender posts numbered messages
+// to one room at a steady rate. Every flapper leaves every 2 to 5 seconds, alternating between
+// "REJOIN <lastSeenId>" on the same connection and a fresh connection under the same name,
+// which relies on the server-side cursor. At the end each flapper must have received every
+// message sent after it first joined exactly once, and the server must never have resent a
+// message the flapper had already confirmed (by REJOIN <id>, or by reading up to its orderly
+// close). Messages that were still in flight when REJOIN went out legitimately come again;
+// they are reported as "overlap" but do not fail the run. The exit code is 0 on success.
+
+namespace {
+
+const int port = 12342;
+const char* serverIp = "127.0.0.1";
+const char* roomName = "flap";
+const char* senderName = "sender";
+const auto handshakePause = std::chrono::milliseconds(50); // The server reads each handshake step as one message
+
+int connectToServer() {
+    int clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (clientSocket == -1) {
+        return -1;
+    }
+    struct sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    inet_pton(AF_INET, serverIp, &(serverAddr.sin_addr));
+    if (connect(clientSocket, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof(serverAddr)) == -1) {
+        close(clientSocket);
+        return -1;
+    }
+    return clientSocket;
+}
+
+void sendText(int clientSocket, const std::string& text) {
+    send(clientSocket, text.c_str(), text.size(), MSG_NOSIGNAL);
+}
+
+void joinRoom(int clientSocket, const std::string& name) {
+    sendText(clientSocket, name);
+    std::this_thread::sleep_for(handshakePause);
+    sendText(clientSocket, roomName);
+    std::this_thread::sleep_for(handshakePause);
+}
+
+}
+
+class FlapClient {
+private:
+    std::string name;
+    int clientSocket = -1;
+    std::string pending; // Bytes of the newest message; it is complete once the next "\n" arrives
+    int lastSeenId = -1;
+    int confirmedId = -1; // The server knows this flapper has everything up to here
+    std::vector<int> receivedCounts; // Index: sender sequence number
+    std::mt19937 random;
+
+public:
+    int flaps = 0;
+    int gaps = 0; // "[Some earlier messages are no longer available]" notices
+    int resent = 0; // Messages at or below confirmedId that arrived again: a server bug
+    int overlap = 0; // Repeats sent after REJOIN of messages that were in flight when it went out
+
+    FlapClient(int index, size_t maxMessages) : name("flapper" + std::to_string(index)), receivedCounts(maxMessages, 0), random(static_cast<unsigned>(index)) {
+    }
+
+    ~FlapClient() {
+        if (clientSocket != -1) {
+            close(clientSocket);
+        }
+    }
+
+    bool connectAndJoin() {
+        clientSocket = connectToServer();
+        if (clientSocket == -1) {
+            return false;
+        }
+        joinRoom(clientSocket, name);
+        return true;
+    }
+
+    void run(std::chrono::steady_clock::time_point deadline) {
+        auto nextFlap = std::chrono::steady_clock::now() + flapInterval();
+        while (std::chrono::steady_clock::now() < deadline) {
+            auto wakeUp = std::min(nextFlap, deadline);
+            readFor(wakeUp);
+            if (std::chrono::steady_clock::now() >= nextFlap && std::chrono::steady_clock::now() < deadline) {
+                flap();
+                nextFlap = std::chrono::steady_clock::now() + flapInterval();
+            }
+        }
+    }
+
+    // Reads until the connection has been quiet for `quiet`.
+    void drain(std::chrono::milliseconds quiet) {
+        while (readOnce(static_cast<int>(quiet.count())) > 0) {
+        }
+        finishMessage();
+    }
+
+    // Returns {missing, duplicated} for sender messages first..last.
+    std::pair<int, int> check(int lastSequence) const {
+        int first = 0;
+        while (first <= lastSequence && receivedCounts[static_cast<size_t>(first)] == 0) {
+            ++first;
+        }
+        if (first > lastSequence) {
+            return {lastSequence + 1, 0}; // Never received anything
+        }
+        int missing = 0;
+        int duplicated = 0;
+        for (int sequence = first; sequence <= lastSequence; ++sequence) {
+            int count = receivedCounts[static_cast<size_t>(sequence)];
+            if (count == 0) {
+                ++missing;
+            } else if (count > 1) {
+                ++duplicated;
+            }
+        }
+        return {missing, duplicated};
+    }
+
+    const std::string& getName() const {
+        return name;
+    }
+
+private:
+    std::chrono::milliseconds flapInterval() {
+        return std::chrono::milliseconds(2000 + random() % 3000);
+    }
+
+    void flap() {
+        ++flaps;
+        if (flaps % 2 == 1) {
+            std::string command = "REJOIN";
+            if (lastSeenId >= 0) {
+                command += " " + std::to_string(lastSeenId);
+            }
+            confirmedId = lastSeenId;
+            sendText(clientSocket, command);
+            std::this_thread::sleep_for(handshakePause);
+            joinRoom(clientSocket, name);
+            return;
+        }
+
+        // Orderly reconnect: half-close, read everything the server sent before it saw the EOF,
+        // then come back on a new connection and rely on the server's cursor for this name.
+        shutdown(clientSocket, SHUT_WR);
+        while (readOnce(1000) > 0) {
+        }
+        finishMessage();
+        confirmedId = lastSeenId; // Everything the server sent before it saw the EOF has been read
+        close(clientSocket);
+        clientSocket = -1;
+        while (!connectAndJoin()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    void readFor(std::chrono::steady_clock::time_point until) {
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0 || readOnce(static_cast<int>(remaining)) <= 0) {
+                return;
+            }
+        }
+    }
+
+    ssize_t readOnce(int timeoutMs) {
+        struct pollfd readable{clientSocket, POLLIN, 0};
+        if (poll(&readable, 1, timeoutMs) <= 0) {
+            return 0;
+        }
+        char buffer[4096];
+        ssize_t bytes = recv(clientSocket, buffer, sizeof(buffer), 0);
+        if (bytes <= 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < bytes; ++i) {
+            if (buffer[i] == '\x05') {
+                continue; // Heartbeat
+            }
+            if (buffer[i] == '\n' && !pending.empty()) {
+                finishMessage();
+            }
+            pending += buffer[i];
+        }
+        return bytes;
+    }
+
+    // Handles "\n#<id> <name>: <content>", skipping ids already seen, as the real clients do.
+    void finishMessage() {
+        std::string message;
+        message.swap(pending);
+        if (message.compare(0, 2, "\n[") == 0) {
+            ++gaps;
+            return;
+        }
+        if (message.compare(0, 2, "\n#") != 0) {
+            return;
+        }
+        char* end = nullptr;
+        long id = std::strtol(message.c_str() + 2, &end, 10);
+        if (id <= lastSeenId) {
+            ++(id <= confirmedId ? resent : overlap); // Counted here because the real clients hide these
+            return;
+        }
+        lastSeenId = static_cast<int>(id);
+
+        std::string prefix = std::string(" ") + senderName + ": ";
+        size_t contentStart = static_cast<size_t>(end - message.c_str());
+        if (message.compare(contentStart, prefix.size(), prefix) != 0) {
+            return;
+        }
+        // Consecutive sends may arrive as one server message, so every "m<seq>;" is counted.
+        size_t pos = contentStart + prefix.size();
+        while ((pos = message.find('m', pos)) != std::string::npos) {
+            long sequence = std::strtol(message.c_str() + pos + 1, &end, 10);
+            if (*end == ';' && sequence >= 0 && static_cast<size_t>(sequence) < receivedCounts.size()) {
+                ++receivedCounts[static_cast<size_t>(sequence)];
+            }
+            pos = static_cast<size_t>(end - message.c_str());
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    std::string serverPath = argc > 1 ? argv[1] : "./server";
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 60;
+    int flapperCount = argc > 3 ? std::atoi(argv[3]) : 20;
+    const int messagesPerSecond = 100;
+    size_t maxMessages = static_cast<size_t>(seconds + 1) * messagesPerSecond;
+
+    pid_t serverPid = fork();
+    if (serverPid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        execl(serverPath.c_str(), serverPath.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int sender = -1;
+    for (int attempt = 0; attempt < 50 && sender == -1; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        sender = connectToServer();
+    }
+    if (sender == -1) {
+        std::cerr << "Server at " << serverPath << " did not start listening on port " << port << std::endl;
+        kill(serverPid, SIGTERM);
+        waitpid(serverPid, nullptr, 0);
+        return 1;
+    }
+    joinRoom(sender, senderName);
+
+    std::vector<std::unique_ptr<FlapClient>> flappers;
+    for (int i = 0; i < flapperCount; ++i) {
+        flappers.push_back(std::make_unique<FlapClient>(i, maxMessages));
+        if (!flappers.back()->connectAndJoin()) {
+            std::cerr << "Connect failed for " << flappers.back()->getName() << ": " << strerror(errno) << std::endl;
+            kill(serverPid, SIGTERM);
+            waitpid(serverPid, nullptr, 0);
+            return 1;
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    std::vector<std::thread> threads;
+    for (auto& flapper : flappers) {
+        threads.emplace_back(&FlapClient::run, flapper.get(), deadline);
+    }
+
+    int lastSequence = -1;
+    auto nextSend = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() < deadline && static_cast<size_t>(lastSequence + 1) < maxMessages) {
+        sendText(sender, "m" + std::to_string(++lastSequence) + ";");
+        nextSend += std::chrono::milliseconds(1000 / messagesPerSecond);
+        std::this_thread::sleep_until(nextSend);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    int failures = 0;
+    int totalFlaps = 0;
+    int totalResent = 0;
+    int totalOverlap = 0;
+    for (auto& flapper : flappers) {
+        flapper->drain(std::chrono::milliseconds(1000));
+        auto [missing, duplicated] = flapper->check(lastSequence);
+        totalFlaps += flapper->flaps;
+        totalResent += flapper->resent;
+        totalOverlap += flapper->overlap;
+        if (missing > 0 || duplicated > 0 || flapper->gaps > 0 || flapper->resent > 0) {
+            ++failures;
+            std::printf("%s flaps=%d missing=%d duplicated=%d gaps=%d resent=%d\n", flapper->getName().c_str(), flapper->flaps, missing, duplicated, flapper->gaps, flapper->resent);
+        }
+    }
+    std::printf("sent=%d flappers=%d flaps=%d resent=%d overlap=%d failed=%d\n", lastSequence + 1, flapperCount, totalFlaps, totalResent, totalOverlap, failures);
+
+    close(sender);
+    kill(serverPid, SIGTERM);
+    waitpid(serverPid, nullptr, 0);
+    return failures == 0 ? 0 : 1;
+}
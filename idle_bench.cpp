@@ -0,0 +1,229 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Reports the chat server's resident memory per idle connection.
+//
+// Usage: ./idle_bench [server binary] [connection counts...]
+// Defaults to ./server with 100000 and 1000000 connections. Both processes need an open file
+// limit above the largest count (ulimit -n). Connections come from several 127.0.0.x source
+// addresses so loopback does not run out of ephemeral ports. Memory is divided by the
+// connections the server still holds once its handshake deadline has passed, counted from
+// /proc/<pid>/fd, and the run fails if that is below the target.
+
+class IdleBench {
+private:
+    int port = 12342;
+    const char* serverIp = "127.0.0.1";
+    static constexpr size_t connectionsPerSource = 20000;
+    static constexpr size_t handshakeBatch = 20000; // Connections whose room is sent together
+    static constexpr auto handshakeDeadline = std::chrono::seconds(65); // The server's 60 seconds plus slack
+    pid_t serverPid = -1;
+    std::vector<int> sockets;
+
+public:
+    ~IdleBench() {
+        for (int socket : sockets) {
+            close(socket);
+        }
+        if (serverPid > 0) {
+            kill(serverPid, SIGTERM);
+            waitpid(serverPid, nullptr, 0);
+        }
+    }
+
+    static void raiseFileLimit() {
+        struct rlimit fileLimit;
+        if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+            fileLimit.rlim_cur = fileLimit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &fileLimit);
+        }
+    }
+
+    bool startServer(const std::string& serverPath) {
+        serverPid = fork();
+        if (serverPid == -1) {
+            perror("fork failed");
+            return false;
+        }
+        if (serverPid == 0) {
+            int devNull = open("/dev/null", O_WRONLY);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            execl(serverPath.c_str(), serverPath.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        for (int attempt = 0; attempt < 50; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            int probe = connectFrom(1);
+            if (probe != -1) {
+                close(probe); // The server reaps it once the handshake deadline passes
+                return true;
+            }
+        }
+        std::cerr << "Server at " << serverPath << " did not start listening on port " << port << std::endl;
+        return false;
+    }
+
+    // Descriptors the server holds: one per live connection plus a few of its own.
+    size_t serverDescriptors() const {
+        size_t descriptors = 0;
+        std::error_code error;
+        for (auto it = std::filesystem::directory_iterator("/proc/" + std::to_string(serverPid) + "/fd", error);
+             !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+            ++descriptors;
+        }
+        return descriptors;
+    }
+
+    // Connections that have not sent both handshake steps are shut down by the server once its
+    // deadline passes; waiting that out makes serverDescriptors() count only joined clients.
+    static void waitOutHandshakeDeadline() {
+        std::this_thread::sleep_for(handshakeDeadline);
+    }
+
+    long serverResidentBytes() const {
+        std::ifstream status("/proc/" + std::to_string(serverPid) + "/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) {
+                std::istringstream fields(line.substr(6));
+                long kilobytes = 0;
+                fields >> kilobytes;
+                return kilobytes * 1024;
+            }
+        }
+        return -1;
+    }
+
+    // Waits until the server has processed the latest burst and its RSS stops moving.
+    long settledResidentBytes() const {
+        long previous = serverResidentBytes();
+        for (int attempt = 0; attempt < 40; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            long current = serverResidentBytes();
+            if (current == previous) {
+                return current;
+            }
+            previous = current;
+        }
+        return previous;
+    }
+
+    int connectFrom(size_t sourceIndex) const {
+        int clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (clientSocket == -1) {
+            return -1;
+        }
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+        int noPort = 1;
+        setsockopt(clientSocket, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &noPort, sizeof(noPort));
+#endif
+        struct sockaddr_in sourceAddr{};
+        sourceAddr.sin_family = AF_INET;
+        sourceAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + static_cast<uint32_t>(sourceIndex));
+        struct sockaddr_in serverAddr{};
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(port);
+        inet_pton(AF_INET, serverIp, &(serverAddr.sin_addr));
+
+        if (bind(clientSocket, reinterpret_cast<struct sockaddr*>(&sourceAddr), sizeof(sourceAddr)) == -1 ||
+            connect(clientSocket, reinterpret_cast<struct sockaddr*>(&serverAddr), sizeof(serverAddr)) == -1) {
+            close(clientSocket);
+            return -1;
+        }
+        return clientSocket;
+    }
+
+    // Opens connections until `target` are idle in a room. The server reads each handshake step
+    // as one message, so a batch sends its room only after the next batch has been connected,
+    // which leaves time for its names to be read. Pipelining this way keeps the gap between
+    // name and room far below the server's handshake deadline even for a million connections.
+    bool growTo(size_t target) {
+        size_t awaitingRoom = sockets.size(); // First socket that has sent its name but not its room
+        while (sockets.size() < target) {
+            int clientSocket = connectFrom(1 + sockets.size() / connectionsPerSource);
+            if (clientSocket == -1) {
+                std::cerr << "Connect failed after " << sockets.size() << " connections: " << strerror(errno) << std::endl;
+                break;
+            }
+            send(clientSocket, "idle", 4, MSG_NOSIGNAL);
+            sockets.push_back(clientSocket);
+            if (sockets.size() - awaitingRoom >= 2 * handshakeBatch) {
+                sendRooms(awaitingRoom, awaitingRoom + handshakeBatch);
+                awaitingRoom += handshakeBatch;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        sendRooms(awaitingRoom, sockets.size());
+        return sockets.size() == target;
+    }
+
+    void sendRooms(size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            send(sockets[i], "lobby", 5, MSG_NOSIGNAL);
+        }
+    }
+
+    size_t connectionCount() const {
+        return sockets.size();
+    }
+};
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    IdleBench::raiseFileLimit();
+
+    std::string serverPath = argc > 1 ? argv[1] : "./server";
+    std::vector<size_t> targets;
+    for (int i = 2; i < argc; ++i) {
+        targets.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    if (targets.empty()) {
+        targets = {100000, 1000000};
+    }
+
+    IdleBench bench;
+    if (!bench.startServer(serverPath)) {
+        return 1;
+    }
+    long baseline = bench.settledResidentBytes();
+    size_t baselineDescriptors = bench.serverDescriptors();
+    std::printf("baseline rss_bytes=%ld fds=%zu\n", baseline, baselineDescriptors);
+
+    for (size_t target : targets) {
+        bool complete = bench.growTo(target);
+        IdleBench::waitOutHandshakeDeadline();
+        long resident = bench.settledResidentBytes();
+        size_t descriptors = bench.serverDescriptors();
+        size_t connections = descriptors > baselineDescriptors ? descriptors - baselineDescriptors : 0;
+        double perConnection = connections > 0 ? static_cast<double>(resident - baseline) / static_cast<double>(connections) : 0.0;
+        std::printf("opened=%zu server_connections=%zu rss_bytes=%ld bytes_per_connection=%.1f\n", bench.connectionCount(), connections, resident, perConnection);
+        std::fflush(stdout);
+        if (!complete || connections < target) {
+            std::cerr << "The server holds " << connections << " of " << target << " connections" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,470 @@
+#define CHAT_SERVER_NO_MAIN
+#include "server.cpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+// Microbenchmarks for the server internals.
+//
+// Build and run from the repository root:
+//     g++ -std=c++17 -O2 -pthread -o microbench microbench.cpp && ./microbench
+//
+// Every case runs a fixed amount of work and reports the best of several repetitions, one line
+// per case, so two runs can be diffed directly. Clients are socketpairs drained by a background
+// thread, and files are written to a scratch directory that is removed afterwards. Work is fed
+// in batches and the sinks are drained, untimed, between batches, so no client ever falls far
+// enough behind to be dropped. A case that cannot run as specified, e.g. because too few
+// clients could be opened or the sinks stop draining, is reported on stderr and skipped.
+
+// Discards everything written to std::cout, where the server logs every join and file copy.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+// Socketpairs standing in for clients. The server ends are registered with clientConnections
+// like accepted sockets; a drain thread reads and discards whatever reaches the peer ends and
+// flushes output that spilled into pooled buffers, so sends never block.
+class SinkPool {
+private:
+    static constexpr uint64_t peerTag = 1ull << 32; // Marks peer ends in epoll_event.data
+    static constexpr auto drainTimeout = std::chrono::seconds(10);
+    int epollFd;
+    std::vector<int> serverEnds;
+    std::vector<int> peerEnds;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> drainedBytes{0};
+    std::thread drainThread;
+
+    void drain() {
+        struct epoll_event events[64];
+        char buffer[65536];
+        while (!stopping.load()) {
+            int ready = epoll_wait(epollFd, events, 64, 50);
+            for (int i = 0; i < ready; ++i) {
+                int socket = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+                if (events[i].data.u64 & peerTag) {
+                    ssize_t bytes;
+                    while ((bytes = recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+                        drainedBytes += static_cast<uint64_t>(bytes);
+                    }
+                } else if (events[i].events & EPOLLOUT) {
+                    clientConnections.flush(socket);
+                }
+            }
+        }
+    }
+
+    void watch(int socket, uint32_t events, uint64_t tag) {
+        struct epoll_event event{};
+        event.events = events;
+        event.data.u64 = static_cast<uint32_t>(socket) | tag;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &event);
+    }
+
+public:
+    SinkPool() : epollFd(epoll_create1(EPOLL_CLOEXEC)) {
+        clientConnections.attach(epollFd);
+        drainThread = std::thread(&SinkPool::drain, this);
+    }
+
+    ~SinkPool() {
+        stopping = true;
+        drainThread.join();
+        for (int socket : peerEnds) {
+            close(socket);
+        }
+        close(epollFd);
+    }
+
+    // Returns the server end of a new client, or -1.
+    int add() {
+        int ends[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) == -1) {
+            perror("socketpair failed");
+            return -1;
+        }
+        fcntl(ends[0], F_SETFL, fcntl(ends[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(ends[1], F_SETFL, fcntl(ends[1], F_GETFL, 0) | O_NONBLOCK);
+        if (clientConnections.open(ends[0]) == nullptr) {
+            close(ends[0]);
+            close(ends[1]);
+            return -1;
+        }
+        watch(ends[0], EPOLLRDHUP, 0);
+        watch(ends[1], EPOLLIN, peerTag);
+        serverEnds.push_back(ends[0]);
+        peerEnds.push_back(ends[1]);
+        return ends[0];
+    }
+
+    // Blocks until `bytes` in total have reached the peer ends since the pool was created.
+    // Returns false if that takes longer than drainTimeout, e.g. because a client was dropped.
+    bool waitForDrained(uint64_t bytes) const {
+        auto deadline = std::chrono::steady_clock::now() + drainTimeout;
+        while (drainedBytes.load() < bytes) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // Peer end of a client returned by add(), for writing requests to the server.
+    int peerOf(int serverEnd) const {
+        for (size_t i = 0; i < serverEnds.size(); ++i) {
+            if (serverEnds[i] == serverEnd) {
+                return peerEnds[i];
+            }
+        }
+        return -1;
+    }
+
+    // Unregisters the peer end so the drain thread leaves the responses for the caller to read.
+    void detachPeer(int serverEnd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, peerOf(serverEnd), nullptr);
+    }
+
+    // Hands a server end over to the caller, e.g. to close it through ChatServer::closeClient.
+    void forget(int serverEnd) {
+        serverEnds.erase(std::remove(serverEnds.begin(), serverEnds.end(), serverEnd), serverEnds.end());
+    }
+
+    // Releases every server end; callers remove them from their rooms first.
+    void closeServerEnds() {
+        for (int socket : serverEnds) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr);
+            clientConnections.release(socket);
+            close(socket);
+        }
+        serverEnds.clear();
+    }
+};
+
+class MicroBench {
+private:
+    static constexpr int repetitions = 5;
+    NullBuffer nullBuffer;
+    std::streambuf* coutBuffer = nullptr;
+
+    // Runs `batch` for batchCount batches, timing only the batches and calling `settle` between
+    // them. Returns the best total over the repetitions, or -1 as soon as either returns false.
+    template <typename Batch, typename Settle>
+    static double bestBatchedNanoseconds(size_t batchCount, Batch&& batch, Settle&& settle) {
+        double best = 0;
+        for (int repetition = 0; repetition < repetitions; ++repetition) {
+            double elapsed = 0;
+            for (size_t i = 0; i < batchCount; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                bool finished = batch();
+                elapsed += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                if (!finished || !settle()) {
+                    return -1;
+                }
+            }
+            if (repetition == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        return best;
+    }
+
+    template <typename Work>
+    static double bestNanoseconds(Work&& work) {
+        double best = 0;
+        for (int repetition = 0; repetition < repetitions; ++repetition) {
+            auto start = std::chrono::steady_clock::now();
+            work();
+            double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            if (repetition == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        return best;
+    }
+
+    static void report(const char* benchmark, const std::string& param, size_t iterations, double nanoseconds) {
+        std::printf("%-28s %-16s %10zu %14.1f\n", benchmark, param.c_str(), iterations, nanoseconds / static_cast<double>(iterations));
+        std::fflush(stdout);
+    }
+
+    static void skip(const char* benchmark, const std::string& param, const char* reason) {
+        std::fprintf(stderr, "%s %s skipped: %s\n", benchmark, param.c_str(), reason);
+    }
+
+    // Blocks until the room's broadcaster has handled every message queued so far. Returns
+    // false if it has not within 10 seconds.
+    static bool waitForBroadcast(ChatRoom& room) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (std::chrono::steady_clock::now() < deadline) {
+            {
+                std::lock_guard<std::mutex> lock(room.roomMutex);
+                if (room.lastBroadcastId == room.nextMessageId - 1) {
+                    return true;
+                }
+            }
+            std::this_thread::yield();
+        }
+        return false;
+    }
+
+    // Returns how many receivers actually joined; fewer than asked for once descriptors run out.
+    static int fillRoom(ChatRoom& room, SinkPool& sinks, int receivers) {
+        int joined = 0;
+        for (int i = 0; i < receivers; ++i) {
+            int clientSocket = sinks.add();
+            if (clientSocket == -1) {
+                break;
+            }
+            room.joinClient(clientSocket, "receiver" + std::to_string(i), -1);
+            ++joined;
+        }
+        return joined;
+    }
+
+    static void emptyRoom(ChatRoom& room) {
+        std::vector<int> clients;
+        {
+            std::lock_guard<std::mutex> lock(room.roomMutex);
+            clients = room.clients;
+        }
+        for (int clientSocket : clients) {
+            room.removeClient(clientSocket, "");
+        }
+    }
+
+public:
+    MicroBench() {
+        coutBuffer = std::cout.rdbuf(&nullBuffer);
+    }
+
+    ~MicroBench() {
+        std::cout.rdbuf(coutBuffer);
+    }
+
+    static void printHeader() {
+        std::printf("%-28s %-16s %10s %14s\n", "benchmark", "param", "iterations", "ns/op");
+    }
+
+    // addMessageToQueue from the caller's side until the broadcaster has sent every message.
+    void queueAndBroadcast() {
+        const size_t batchSize = 1000;
+        const size_t batchCount = 20;
+        for (int wanted : {1, 16}) {
+            SinkPool sinks;
+            ChatRoom room("bench");
+            int receivers = fillRoom(room, sinks, wanted);
+            std::string param = "receivers=" + std::to_string(receivers);
+            ChatMessage message{"hello from the benchmark", "sender", " ", -1};
+            uint64_t bytesPerBatch = ChatRoom::formatTextMessage(message).length() * batchSize * static_cast<uint64_t>(receivers);
+            uint64_t expectedBytes = 0;
+
+            double nanoseconds = receivers == 0 ? -1 : bestBatchedNanoseconds(batchCount, [&] {
+                for (size_t i = 0; i < batchSize; ++i) {
+                    room.addMessageToQueue(message);
+                }
+                return waitForBroadcast(room);
+            }, [&] {
+                expectedBytes += bytesPerBatch;
+                return sinks.waitForDrained(expectedBytes);
+            });
+            if (nanoseconds < 0) {
+                skip("room.queue_broadcast", param, receivers == 0 ? "no clients could be opened" : "clients stopped draining");
+            } else {
+                report("room.queue_broadcast", param, batchSize * batchCount, nanoseconds);
+            }
+
+            emptyRoom(room);
+            sinks.closeServerEnds();
+        }
+    }
+
+    // One processTextMessage call fans a message out to every other client in the room.
+    void textFanOut() {
+        for (int wanted : {1, 10, 100, 1000}) {
+            SinkPool sinks;
+            ChatRoom room("bench");
+            int receivers = fillRoom(room, sinks, wanted);
+            std::string param = "receivers=" + std::to_string(receivers);
+            if (receivers == 0) {
+                skip("room.text_fanout", param, "no clients could be opened");
+                continue;
+            }
+            ChatMessage message{"hello from the benchmark", "sender", " ", -1, 0};
+            size_t batchSize = std::max<size_t>(1, 1000 / static_cast<size_t>(receivers));
+            size_t batchCount = 200;
+            uint64_t bytesPerBatch = ChatRoom::formatTextMessage(message).length() * batchSize * static_cast<uint64_t>(receivers);
+            uint64_t expectedBytes = 0;
+
+            double nanoseconds = bestBatchedNanoseconds(batchCount, [&] {
+                std::lock_guard<std::mutex> lock(room.roomMutex); // The broadcaster holds it in production
+                for (size_t i = 0; i < batchSize; ++i) {
+                    room.processTextMessage(message);
+                }
+                return true;
+            }, [&] {
+                expectedBytes += bytesPerBatch;
+                return sinks.waitForDrained(expectedBytes);
+            });
+            if (nanoseconds < 0) {
+                skip("room.text_fanout", param, "clients stopped draining");
+            } else {
+                report("room.text_fanout", param, batchSize * batchCount, nanoseconds);
+            }
+
+            emptyRoom(room);
+            sinks.closeServerEnds();
+        }
+    }
+
+    // Lookups of existing rooms from several threads at once.
+    void roomLookup(ChatServer& server) {
+        const int roomCount = 64;
+        const size_t lookupsPerThread = 100000;
+        std::vector<std::string> names;
+        for (int i = 0; i < roomCount; ++i) {
+            names.push_back("room" + std::to_string(i));
+            server.findOrCreateRoom(names.back());
+        }
+
+        for (int threads : {1, 2, 4, 8}) {
+            double nanoseconds = bestNanoseconds([&] {
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; ++t) {
+                    workers.emplace_back([&, t] {
+                        for (size_t i = 0; i < lookupsPerThread; ++i) {
+                            server.findOrCreateRoom(names[(i + static_cast<size_t>(t)) % roomCount]);
+                        }
+                    });
+                }
+                for (auto& worker : workers) {
+                    worker.join();
+                }
+            });
+            report("server.find_room", "threads=" + std::to_string(threads), lookupsPerThread * static_cast<size_t>(threads), nanoseconds);
+        }
+    }
+
+    void fileCopy() {
+        SinkPool sinks;
+        int clientSocket = sinks.add();
+        if (clientSocket == -1) {
+            skip("file.copy", "", "no client could be opened");
+            return;
+        }
+        uint32_t generation = clientConnections.at(clientSocket).generation;
+        std::vector<std::pair<size_t, size_t>> cases = {{1 << 10, 2000}, {64 << 10, 500}, {1 << 20, 50}, {16 << 20, 5}};
+
+        for (const auto& [fileSize, copies] : cases) {
+            std::string source = "source_" + std::to_string(fileSize);
+            {
+                std::ofstream file(source, std::ios::binary);
+                std::string block(fileSize, 'x');
+                file.write(block.data(), static_cast<std::streamsize>(block.size()));
+            }
+
+            double nanoseconds = bestNanoseconds([&] {
+                for (size_t i = 0; i < copies; ++i) {
+                    FileManager::copyFile(source, "copy.bin", clientSocket, generation);
+                }
+            });
+            report("file.copy", "bytes=" + std::to_string(fileSize), copies, nanoseconds);
+        }
+        sinks.closeServerEnds();
+    }
+
+    // handleCommunication end to end for a single recv: read, parse and dispatch.
+    void commandParsing(ChatServer& server) {
+        const size_t commands = 20000;
+        SinkPool sinks;
+
+        auto joinedClient = [&](const char* name, const char* roomName) {
+            int clientSocket = sinks.add();
+            if (clientSocket == -1) {
+                return -1;
+            }
+            sinks.detachPeer(clientSocket);
+            int peer = sinks.peerOf(clientSocket);
+            send(peer, name, strlen(name), 0);
+            server.handleCommunication(clientSocket);
+            send(peer, roomName, strlen(roomName), 0);
+            server.handleCommunication(clientSocket);
+            return clientSocket;
+        };
+
+        auto runCommands = [&](const char* label, int clientSocket, const std::vector<std::string>& sequence) {
+            int peer = sinks.peerOf(clientSocket);
+            size_t rounds = commands / sequence.size();
+            double nanoseconds = bestNanoseconds([&] {
+                for (size_t i = 0; i < rounds; ++i) {
+                    for (const std::string& command : sequence) {
+                        send(peer, command.c_str(), command.length(), 0);
+                        server.handleCommunication(clientSocket);
+                    }
+                }
+            });
+            report("server.handle_command", label, rounds * sequence.size(), nanoseconds);
+        };
+
+        int textClient = joinedClient("benchtext", "parse_text");
+        int noFileClient = joinedClient("benchno", "parse_no");
+        int rejoinClient = joinedClient("benchrejoin", "parse_rejoin_a");
+        if (textClient != -1 && noFileClient != -1 && rejoinClient != -1) {
+            runCommands("text", textClient, {"hello from the benchmark"});
+            runCommands("no_file", noFileClient, {"NO missing.txt"});
+            runCommands("rejoin", rejoinClient, {"REJOIN 0", "benchrejoin", "parse_rejoin_b", "REJOIN", "benchrejoin", "parse_rejoin_a"});
+            waitForBroadcast(*server.findOrCreateRoom("parse_text"));
+        } else {
+            skip("server.handle_command", "", "no clients could be opened");
+        }
+
+        for (int clientSocket : {textClient, noFileClient, rejoinClient}) {
+            if (clientSocket != -1) {
+                sinks.forget(clientSocket);
+                server.closeClient(clientConnections.at(clientSocket)); // Also cancels its heartbeat timer
+            }
+        }
+    }
+};
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+        fileLimit.rlim_cur = fileLimit.rlim_max; // textFanOut holds two descriptors per receiver
+        setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+
+    char scratch[] = "/tmp/chat_microbench_XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        perror("Creating scratch directory failed");
+        return 1;
+    }
+    if (chdir(scratch) == -1) {
+        perror("Entering scratch directory failed");
+        std::filesystem::remove_all(scratch);
+        return 1;
+    }
+
+    {
+        MicroBench bench;
+        ChatServer server; // Never run(); only its room table and command handling are exercised
+        MicroBench::printHeader();
+        bench.queueAndBroadcast();
+        bench.textFanOut();
+        bench.roomLookup(server);
+        bench.fileCopy();
+        bench.commandParsing(server);
+    }
+
+    std::filesystem::remove_all(scratch);
+    return 0;
+}
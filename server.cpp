@@ -7,14 +7,28 @@
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <deque>
+#include <list>
+#include <unordered_map>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/stat.h>
 #include <algorithm>
 #include <condition_variable>
 #include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <atomic>
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -33,6 +47,9 @@ public:
             serverAddress.sin_addr.s_addr = INADDR_ANY;
             serverAddress.sin_port = htons(port);
 
+            int reuse = 1; // Restarting must not wait for old connections to leave TIME_WAIT
+            setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
             if (bind(serverSocket, reinterpret_cast<struct sockaddr*>(&serverAddress), sizeof(serverAddress)) == -1) {
                 reportError("Bind failed");
                 close(serverSocket);
@@ -69,15 +86,442 @@ public:
     void closeConnection(){
         close(serverSocket);
     }
+
+    int getSocket() const {
+        return serverSocket;
+    }
+
+    // Bounds how long a dead peer can hold a connection: unacknowledged data older than
+    // ackTimeoutMs aborts it.
+    void setClientTimeouts(int clientSocket, int ackTimeoutMs) const {
+        if (setsockopt(clientSocket, IPPROTO_TCP, TCP_USER_TIMEOUT, &ackTimeoutMs, sizeof(ackTimeoutMs)) == -1) {
+            reportError("Setting TCP_USER_TIMEOUT failed");
+        }
+    }
+
+    bool setNonBlocking(int socket) const {
+        int flags = fcntl(socket, F_GETFL, 0);
+        if (flags == -1 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+            reportError("Setting O_NONBLOCK failed");
+            return false;
+        }
+        return true;
+    }
 };
 
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint32_t expiry = 0;
+};
+
+// Hierarchical timing wheel: four levels of 64 slots each. Scheduling, cancelling and each
+// tick are O(1) no matter how many timers are armed; nodes are intrusive, so the wheel never allocates.
+class TimerWheel {
+public:
+    // Called with the wheel locked, so it should only decide and take note; anything slow, such
+    // as a syscall, belongs after tick() returns. A non-zero return re-arms the timer that many
+    // ticks ahead.
+    using ExpiryHandler = std::function<uint32_t(TimerNode&)>;
+
+    explicit TimerWheel(ExpiryHandler handler) : onExpire(std::move(handler)) {
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                slot.prev = slot.next = &slot;
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    void schedule(TimerNode& node, uint32_t ticks) {
+        std::lock_guard<std::mutex> lock(wheelMutex);
+        unlink(node);
+        node.expiry = now + std::max<uint32_t>(ticks, 1);
+        link(node);
+    }
+
+    void cancel(TimerNode& node) {
+        std::lock_guard<std::mutex> lock(wheelMutex);
+        unlink(node);
+    }
+
+    void tick() {
+        std::lock_guard<std::mutex> lock(wheelMutex);
+        ++now;
+
+        // Each time a level wraps, the matching slot of the level above is pulled down.
+        for (int level = 1; level < levelCount; ++level) {
+            uint32_t lowerBits = now & ((1u << (level * slotBits)) - 1);
+            if (lowerBits != 0) {
+                break;
+            }
+            TimerNode& slot = slots[level][(now >> (level * slotBits)) & slotMask];
+            while (slot.next != &slot) {
+                TimerNode& node = *slot.next;
+                unlink(node);
+                link(node);
+            }
+        }
+
+        TimerNode& due = slots[0][now & slotMask];
+        while (due.next != &due) {
+            TimerNode& node = *due.next;
+            unlink(node);
+            uint32_t again = onExpire(node);
+            if (again > 0) {
+                node.expiry = now + again;
+                link(node);
+            }
+        }
+    }
+
+private:
+    static constexpr int levelCount = 4;
+    static constexpr int slotBits = 6;
+    static constexpr uint32_t slotCount = 1u << slotBits;
+    static constexpr uint32_t slotMask = slotCount - 1;
+    static constexpr uint32_t maxDelay = (1u << (levelCount * slotBits)) - 1;
+
+    TimerNode slots[levelCount][slotCount];
+    uint32_t now = 0;
+    std::mutex wheelMutex;
+    ExpiryHandler onExpire;
+
+    void link(TimerNode& node) {
+        uint32_t delay = node.expiry - now;
+        if (delay > maxDelay) {
+            delay = maxDelay;
+            node.expiry = now + delay;
+        }
+        int level = 0;
+        while (level < levelCount - 1 && delay >= (1u << ((level + 1) * slotBits))) {
+            ++level;
+        }
+        TimerNode& slot = slots[level][(node.expiry >> (level * slotBits)) & slotMask];
+        node.prev = slot.prev;
+        node.next = &slot;
+        slot.prev->next = &node;
+        slot.prev = &node;
+    }
+
+    static void unlink(TimerNode& node) {
+        if (node.next == nullptr) {
+            return;
+        }
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = node.next = nullptr;
+    }
+};
+
+// Fixed-size buffers shared by every connection. A connection borrows one only while it has
+// data in flight, so idle connections cost no buffer memory at all.
+class BufferPool {
+public:
+    static constexpr size_t bufferSize = 1024;
+    static constexpr size_t maxFreeBuffers = 4096; // Beyond this, released buffers go back to the heap
+
+    struct Buffer {
+        Buffer* next = nullptr;
+        uint16_t begin = 0; // First unsent byte
+        uint16_t end = 0; // One past the last valid byte
+        char data[bufferSize];
+    };
+
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool() {
+        while (freeList != nullptr) {
+            Buffer* buffer = freeList;
+            freeList = buffer->next;
+            delete buffer;
+        }
+    }
+
+    Buffer* acquire() {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (freeList != nullptr) {
+                Buffer* buffer = freeList;
+                freeList = buffer->next;
+                --freeCount;
+                buffer->next = nullptr;
+                buffer->begin = buffer->end = 0;
+                return buffer;
+            }
+        }
+        return new Buffer;
+    }
+
+    void release(Buffer* buffer) {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (freeCount < maxFreeBuffers) {
+                buffer->next = freeList;
+                freeList = buffer;
+                ++freeCount;
+                return;
+            }
+        }
+        delete buffer;
+    }
+
+private:
+    std::mutex poolMutex;
+    Buffer* freeList = nullptr;
+    size_t freeCount = 0;
+};
+
+class ChatRoom;
+
+enum class ConnectionState : uint8_t {
+    Free, // Slot not in use
+    AwaitName, // Waiting for the client name
+    AwaitRoom, // Waiting for the room name
+    InRoom // Handshake done; commands and chat messages
+};
+
+// Everything the server keeps for one client. Kept deliberately small because most users sit
+// idle: no buffers (see BufferPool) and no folder paths, which are derived from the name on demand.
+struct Connection : TimerNode {
+    int clientSocket = -1;
+    ChatRoom* room = nullptr;
+    BufferPool::Buffer* pendingOutput = nullptr; // Data the kernel would not take yet, oldest first
+    std::string clientName;
+    int lastSeenId = -1; // From "REJOIN <id>", used by the next join
+    uint32_t generation = 0; // Bumped on release, so replies finished after a close never reach the fd's next owner
+    ConnectionState state = ConnectionState::Free;
+    std::atomic<bool> joined{false}; // Set once the first name/room handshake has completed; read by the heartbeat thread
+    bool dropped = false; // Shut down after a failed send; further output is discarded
+};
+
+static_assert(sizeof(Connection) <= 96, "Connection is paid for by every idle client; keep it compact");
+
+// Connection slots indexed by fd, allocated in blocks that never move so room threads can
+// reach a connection while the event loop opens others. Output is serialised per connection by
+// a striped lock: a send goes straight to the kernel and only spills into pooled buffers,
+// flushed on EPOLLOUT, when the socket is full.
+class ClientConnections {
+public:
+    static constexpr int blockBits = 12;
+    static constexpr int blockSize = 1 << blockBits;
+    static constexpr int maxConnections = 1 << 21;
+    static constexpr size_t maxPendingBuffers = 64; // A client this far behind is dropped
+    static constexpr int lockStripes = 64;
+
+    void attach(int epoll) {
+        epollFd = epoll;
+    }
+
+    // Called from the event loop only. Returns nullptr when fd is beyond maxConnections.
+    Connection* open(int clientSocket) {
+        if (clientSocket < 0 || clientSocket >= maxConnections) {
+            return nullptr;
+        }
+        std::unique_ptr<Connection[]>& block = blocks[clientSocket >> blockBits];
+        if (!block) {
+            block = std::make_unique<Connection[]>(blockSize);
+        }
+        Connection& connection = block[clientSocket & (blockSize - 1)];
+        connection.clientSocket = clientSocket;
+        connection.state = ConnectionState::AwaitName;
+        return &connection;
+    }
+
+    Connection& at(int clientSocket) {
+        return blocks[clientSocket >> blockBits][clientSocket & (blockSize - 1)];
+    }
+
+    // Drops any unsent output and returns the slot to its idle state. The caller must already
+    // have removed the connection from its room and the heartbeat wheel.
+    void release(int clientSocket) {
+        Connection& connection = at(clientSocket);
+        {
+            std::lock_guard<std::mutex> lock(stripeFor(clientSocket));
+            releaseChain(connection.pendingOutput);
+            connection.pendingOutput = nullptr;
+            ++connection.generation;
+        }
+        std::string().swap(connection.clientName);
+        connection.room = nullptr;
+        connection.lastSeenId = -1;
+        connection.joined = false;
+        connection.dropped = false;
+        connection.state = ConnectionState::Free;
+        connection.clientSocket = -1;
+    }
+
+    // Safe from any thread. A peer that errors out or falls too far behind is shut down, which
+    // makes the event loop see a hangup and reap it.
+    void sendTo(int clientSocket, const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(stripeFor(clientSocket));
+        sendLocked(at(clientSocket), data, length);
+    }
+
+    // Shuts the connection down, as after a failed send, unless it has closed since it had
+    // `generation`. The event loop then sees a hangup and reaps it.
+    void drop(int clientSocket, uint32_t generation, const char* reason) {
+        std::lock_guard<std::mutex> lock(stripeFor(clientSocket));
+        Connection& connection = at(clientSocket);
+        if (connection.generation == generation && !connection.dropped) {
+            dropClient(connection, reason);
+        }
+    }
+
+    // For replies produced off the event loop: discarded once the connection that had
+    // `generation` when the work was posted has closed.
+    void sendTo(int clientSocket, uint32_t generation, const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(stripeFor(clientSocket));
+        Connection& connection = at(clientSocket);
+        if (connection.generation == generation) {
+            sendLocked(connection, data, length);
+        }
+    }
+
+    // True while the connection has output the kernel has not taken yet, or has been dropped.
+    bool backlogged(int clientSocket) {
+        std::lock_guard<std::mutex> lock(stripeFor(clientSocket));
+        Connection& connection = at(clientSocket);
+        return connection.pendingOutput != nullptr || connection.dropped;
+    }
+
+    // Called from the event loop when a socket with pending output becomes writable. Returns
+    // true once everything queued has been handed to the kernel.
+    bool flush(int clientSocket) {
+        std::lock_guard<std::mutex> lock(stripeFor(clientSocket));
+        Connection& connection = at(clientSocket);
+
+        while (connection.pendingOutput != nullptr) {
+            BufferPool::Buffer* buffer = connection.pendingOutput;
+            ssize_t sent = send(clientSocket, buffer->data + buffer->begin, buffer->end - buffer->begin, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    dropClient(connection, strerror(errno));
+                }
+                return false;
+            }
+            buffer->begin = static_cast<uint16_t>(buffer->begin + sent);
+            if (buffer->begin < buffer->end) {
+                return false;
+            }
+            connection.pendingOutput = buffer->next;
+            pool.release(buffer);
+        }
+        watch(clientSocket, EPOLLIN);
+        return !connection.dropped;
+    }
+
+    BufferPool& buffers() {
+        return pool;
+    }
+
+private:
+    std::unique_ptr<Connection[]> blocks[maxConnections >> blockBits];
+    std::mutex stripes[lockStripes];
+    BufferPool pool;
+    int epollFd = -1;
+
+    std::mutex& stripeFor(int clientSocket) {
+        return stripes[clientSocket & (lockStripes - 1)];
+    }
+
+    // Caller holds the connection's stripe lock.
+    void sendLocked(Connection& connection, const char* data, size_t length) {
+        int clientSocket = connection.clientSocket;
+        if (connection.dropped || clientSocket == -1) {
+            return;
+        }
+
+        if (connection.pendingOutput == nullptr) {
+            while (length > 0) {
+                ssize_t sent = send(clientSocket, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (sent == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        break;
+                    }
+                    dropClient(connection, strerror(errno));
+                    return;
+                }
+                data += sent;
+                length -= static_cast<size_t>(sent);
+            }
+            if (length == 0) {
+                return;
+            }
+        }
+
+        bool wasIdle = connection.pendingOutput == nullptr;
+        BufferPool::Buffer* tail = nullptr;
+        size_t chainLength = 0;
+        for (BufferPool::Buffer* buffer = connection.pendingOutput; buffer != nullptr; buffer = buffer->next) {
+            tail = buffer;
+            ++chainLength;
+        }
+        while (length > 0) {
+            if (tail == nullptr || tail->end == BufferPool::bufferSize) {
+                if (++chainLength > maxPendingBuffers) {
+                    dropClient(connection, "too much unsent output");
+                    return;
+                }
+                BufferPool::Buffer* buffer = pool.acquire();
+                (tail == nullptr ? connection.pendingOutput : tail->next) = buffer;
+                tail = buffer;
+            }
+            size_t chunk = std::min(length, BufferPool::bufferSize - tail->end);
+            memcpy(tail->data + tail->end, data, chunk);
+            tail->end = static_cast<uint16_t>(tail->end + chunk);
+            data += chunk;
+            length -= chunk;
+        }
+        if (wasIdle) {
+            watch(clientSocket, EPOLLIN | EPOLLOUT);
+        }
+    }
+
+    void releaseChain(BufferPool::Buffer* buffer) {
+        while (buffer != nullptr) {
+            BufferPool::Buffer* next = buffer->next;
+            pool.release(buffer);
+            buffer = next;
+        }
+    }
+
+    // Caller holds the connection's stripe lock.
+    void dropClient(Connection& connection, const char* reason) {
+        std::cerr << "Dropping client " << connection.clientSocket << ": " << reason << std::endl;
+        releaseChain(connection.pendingOutput);
+        connection.pendingOutput = nullptr;
+        connection.dropped = true;
+        shutdown(connection.clientSocket, SHUT_RDWR);
+    }
+
+    void watch(int clientSocket, uint32_t events) {
+        struct epoll_event event{};
+        event.events = events | EPOLLRDHUP;
+        event.data.fd = clientSocket;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, clientSocket, &event);
+    }
+};
+
+ClientConnections clientConnections;
+
 class ChatMessage {
 public:
     std::string content;
     std::string senderName;
     std::string filename;
     int senderSocket;
-    int messageId;
+    int messageId = -1; // Assigned by ChatRoom::addMessageToQueue
 };
 
 class ChatRoom {
@@ -89,27 +533,88 @@ public:
     std::mutex roomMutex;
     std::condition_variable messageCondition;
     int nextMessageId = 0;
+    int lastBroadcastId = -1; // Id of the newest message already delivered to the room
+    bool closing = false; // Set by the destructor to stop roomThread
+    std::deque<ChatMessage> history; // Recently broadcast messages kept for delta sync
+    struct ReadCursor {
+        int firstUnread; // First messageId the user has not received
+        std::list<std::string>::iterator order; // Position in cursorOrder
+    };
+    std::unordered_map<std::string, ReadCursor> readCursors; // One entry per absent user
+    std::list<std::string> cursorOrder; // Names in readCursors, least recently saved first
+    std::unordered_map<int, int> replaying; // Socket -> next messageId to replay, while a join is catching up
+
+    static constexpr size_t historyLimit = 512;
+    static constexpr size_t cursorLimit = 4096;
+    static constexpr size_t syncBatchBytes = 1024; // Replayed messages are sent in chunks of about this size
 
     explicit ChatRoom(std::string name) : name(std::move(name)) {
         roomThread = std::thread(&ChatRoom::broadcastMessages, this);
     }
 
-    void addClient(int clientSocket) {
+    ~ChatRoom() {
+        {
+            std::lock_guard<std::mutex> lock(roomMutex);
+            closing = true;
+        }
+        messageCondition.notify_one();
+        roomThread.join();
+    }
+
+    // Adds the client and starts streaming every message it missed since lastSeenId.
+    // A negative lastSeenId means "use the cursor stored when this user last left".
+    void joinClient(int clientSocket, const std::string& clientName, int lastSeenId) {
         std::lock_guard<std::mutex> lock(roomMutex);
         clients.push_back(clientSocket);
         std::cout << "Client " << clientSocket << " joined room " << name << std::endl;
+
+        int firstUnread = lastSeenId >= 0 ? lastSeenId + 1 : -1; // -1: nothing known about this user
+        auto cursor = readCursors.find(clientName);
+        if (cursor != readCursors.end()) {
+            if (firstUnread < 0) {
+                firstUnread = cursor->second.firstUnread;
+            }
+            cursorOrder.erase(cursor->second.order);
+            readCursors.erase(cursor); // Present users need no cursor
+        }
+        if (firstUnread < 0 || firstUnread > lastBroadcastId) {
+            return;
+        }
+        sendMissedMessages(clientSocket, clientName, firstUnread);
     }
 
-    void removeClient(int clientSocket) {
+    // Remembers how far the user has read so a later join can catch up.
+    void removeClient(int clientSocket, const std::string& clientName) {
         std::lock_guard<std::mutex> lock(roomMutex);
-        clients.erase(std::remove(clients.begin(), clients.end(), clientSocket), clients.end());
+        auto it = std::find(clients.begin(), clients.end(), clientSocket);
+        if (it == clients.end()) {
+            return;
+        }
+        clients.erase(it);
+        int firstUnread = lastBroadcastId + 1; // 0 when the room has broadcast nothing yet
+        auto replay = replaying.find(clientSocket);
+        if (replay != replaying.end()) {
+            firstUnread = replay->second; // Left before the replay finished
+            replaying.erase(replay);
+        }
+        saveReadCursor(clientName, firstUnread);
         std::cout << "Client " << clientSocket << " left room " << name << std::endl;
     }
 
+    // Sends the next part of an unfinished replay; called once the client's socket has drained.
+    void resumeReplay(int clientSocket, const std::string& clientName) {
+        std::lock_guard<std::mutex> lock(roomMutex);
+        auto replay = replaying.find(clientSocket);
+        if (replay != replaying.end()) {
+            sendMissedMessages(clientSocket, clientName, replay->second);
+        }
+    }
+
     void addMessageToQueue(const ChatMessage& message) {
         {
             std::lock_guard<std::mutex> lock(roomMutex); // Lock the mutex to ensure thread safety
             messageQueue.push(message); // Add the message to the message queue
+            messageQueue.back().messageId = nextMessageId++; // Ids are assigned under the lock so they stay unique and ordered
         }
         messageCondition.notify_one(); // Notify one waiting thread that a new message is available
     }
@@ -119,24 +624,35 @@ public:
         return name;
     }
 
+    // Every delivered message starts with "\n#<messageId> " so clients can tell the server the
+    // last id they saw when they send REJOIN.
+    static std::string formatTextMessage(const ChatMessage& message) {
+        return "\n#" + std::to_string(message.messageId) + " " + singleLine(message.senderName) + ": " + singleLine(message.content);
+    }
+
+    // Peer text goes out on one line, so "\n" only ever starts a server message and a client can
+    // trust the tag that follows it; a peer cannot forge one inside its own text.
+    static std::string singleLine(std::string text) {
+        std::replace(text.begin(), text.end(), '\n', ' ');
+        return text;
+    }
+
     void processFileMessage(const ChatMessage& message) {
-        std::unique_lock<std::mutex> lock(roomMutex);
         std::cout << "Client " << message.senderSocket << " wants to send a file: " << message.filename << std::endl;
 
         for (int clientSocket : clients) {
-            if (clientSocket != message.senderSocket) {
-                std::string askClient = "\nClient " + message.senderName + " wants to send " + message.filename + ". Do you want to receive? (YES/NO)";
-                send(clientSocket, askClient.c_str(), askClient.length(), 0);
+            if (clientSocket != message.senderSocket && !isReplaying(clientSocket)) {
+                std::string askClient = "\n#" + std::to_string(message.messageId) + " Client " + singleLine(message.senderName) + " wants to send " + singleLine(message.filename) + ". Do you want to receive? (YES/NO)";
+                deliver(clientSocket, askClient);
             }
         }
     }
 
     void processTextMessage(const ChatMessage& message) {
-        std::unique_lock<std::mutex> lock(roomMutex);
+        std::string messageContentName = formatTextMessage(message);
         for (int clientSocket : clients) {
-            if (clientSocket != message.senderSocket) {
-                std::string messageContentName = "\n" + message.senderName + ": " + message.content;
-                send(clientSocket, messageContentName.c_str(), messageContentName.length(), 0);
+            if (clientSocket != message.senderSocket && !isReplaying(clientSocket)) {
+                deliver(clientSocket, messageContentName);
             }
         }
     }
@@ -144,7 +660,7 @@ public:
     void broadcastMessages() {
         while (true) {
             std::unique_lock<std::mutex> lock(roomMutex);
-            messageCondition.wait(lock, [this]{ return !messageQueue.empty(); });
+            messageCondition.wait(lock, [this]{ return !messageQueue.empty() || closing; });
 
             while (!messageQueue.empty()) {
                 ChatMessage message = messageQueue.front();
@@ -155,25 +671,153 @@ public:
                 } else {
                     processTextMessage(message);
                 }
+                recordHistory(message); // Recorded even when nobody is present, so later joins can catch up
             }
 
-            if (clients.empty()) {
+            if (closing) {
                 break;
             }
         }
     }
 
+private:
+    static void deliver(int clientSocket, const std::string& data) {
+        clientConnections.sendTo(clientSocket, data.c_str(), data.length());
+    }
 
+    // Caller must hold roomMutex. A client that is still catching up gets live messages through
+    // its replay, which reads them from history, so they cannot overtake older ones.
+    bool isReplaying(int clientSocket) const {
+        return !replaying.empty() && replaying.count(clientSocket) > 0;
+    }
+
+    // Caller must hold roomMutex.
+    void recordHistory(const ChatMessage& message) {
+        lastBroadcastId = message.messageId;
+        history.push_back(message);
+        if (history.size() > historyLimit) {
+            history.pop_front();
+        }
+    }
+
+    // Caller must hold roomMutex. Keeps at most cursorLimit entries by evicting the least
+    // recently saved one, in constant time so frequent leaves never stall the broadcaster.
+    void saveReadCursor(const std::string& clientName, int firstUnread) {
+        auto cursor = readCursors.find(clientName);
+        if (cursor != readCursors.end()) {
+            cursor->second.firstUnread = firstUnread;
+            cursorOrder.splice(cursorOrder.end(), cursorOrder, cursor->second.order);
+            return;
+        }
+        cursorOrder.push_back(clientName);
+        readCursors.emplace(clientName, ReadCursor{firstUnread, std::prev(cursorOrder.end())});
+        if (readCursors.size() > cursorLimit) {
+            readCursors.erase(cursorOrder.front());
+            cursorOrder.pop_front();
+        }
+    }
+
+    // Caller must hold roomMutex. Sends missed messages from firstUnread on, a chunk at a time,
+    // and stops as soon as the client's socket backs up, so a long replay never piles up in its
+    // output buffers (and trips the backlog limit) while the connection is still ramping up.
+    // resumeReplay picks it up again once the socket drains. File offers are not replayed: the
+    // server only keeps the most recent upload around. Neither are the user's own messages,
+    // which were never delivered back to them in the first place.
+    void sendMissedMessages(int clientSocket, const std::string& clientName, int firstUnread) {
+        if (!history.empty() && history.front().messageId > firstUnread) {
+            std::string notice = "\n[Some earlier messages are no longer available]";
+            deliver(clientSocket, notice);
+            firstUnread = history.front().messageId;
+        }
+
+        size_t index = history.empty() ? 0 : static_cast<size_t>(firstUnread - history.front().messageId); // Ids in history are consecutive
+        std::string batch;
+        while (index < history.size()) {
+            const ChatMessage& message = history[index++];
+            if (message.content.find("SEND ") == 0 || message.senderName == clientName) {
+                continue;
+            }
+            batch += formatTextMessage(message);
+            if (batch.length() >= syncBatchBytes) {
+                deliver(clientSocket, batch);
+                batch.clear();
+                if (clientConnections.backlogged(clientSocket)) {
+                    break;
+                }
+            }
+        }
+        if (!batch.empty()) {
+            deliver(clientSocket, batch);
+        }
+
+        if (index < history.size()) {
+            replaying[clientSocket] = history[index].messageId;
+        } else {
+            replaying.erase(clientSocket);
+        }
+    }
 };
 
 class FileManager {
 public:
-    static void copyFile(const std::string& sourcePath, const std::string& destinationPath, const int socket);
+    static void copyFile(const std::string& sourcePath, const std::string& destinationPath, const int socket, uint32_t generation);
+};
+
+// Runs file system work (copies, deletes, directory creation) on one thread, in the order it was
+// posted, so a slow disk never stalls the event loop. Results go back through clientConnections.
+class FileWorker {
+public:
+    FileWorker() : worker(&FileWorker::run, this) {
+    }
+
+    ~FileWorker() { // Finishes everything already posted
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            stopping = true;
+        }
+        tasksCondition.notify_one();
+        worker.join();
+    }
+
+    void post(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.push_back(std::move(task));
+        }
+        tasksCondition.notify_one();
+    }
+
+private:
+    std::mutex tasksMutex;
+    std::condition_variable tasksCondition;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::thread worker; // Last, so everything above exists before it starts
+
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(tasksMutex);
+                tasksCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            try {
+                task();
+            } catch (const std::exception& error) { // e.g. std::filesystem errors; later tasks still run
+                std::cerr << "File task failed: " << error.what() << std::endl;
+            }
+        }
+    }
 };
 
 std::mutex fileMutex;
 
-void FileManager::copyFile(const std::string& sourcePath, const std::string& destinationPath, const int socket) {
+void FileManager::copyFile(const std::string& sourcePath, const std::string& destinationPath, const int socket, uint32_t generation) {
     std::ifstream file(sourcePath, std::ios::binary | std::ios::ate);
 
     if (file.is_open()) {
@@ -184,7 +828,7 @@ void FileManager::copyFile(const std::string& sourcePath, const std::string& des
             std::cerr << "Failed to open file '" << destinationPath << "' for writing." << std::endl;
             fileMutex.unlock();
             const char *error = "File cannot be created.";
-            send(socket, error, strlen(error), 0);
+            clientConnections.sendTo(socket, generation, error, strlen(error));
             return;
         }
 
@@ -200,7 +844,7 @@ void FileManager::copyFile(const std::string& sourcePath, const std::string& des
         }
 
         const char *confirm = "File was saved successfully.";
-        send(socket, confirm, strlen(confirm), 0);
+        clientConnections.sendTo(socket, generation, confirm, strlen(confirm));
 
         fileMutex.lock();
         std::cout << " Client " << socket << " accepted and downloaded a file" << std::endl;
@@ -210,7 +854,7 @@ void FileManager::copyFile(const std::string& sourcePath, const std::string& des
         std::cerr << "Failed to open file '" << sourcePath << "'" << std::endl;
         fileMutex.unlock();
         const char *error = "File not found or cannot be opened.";
-        send(socket, error, strlen(error), 0);
+        clientConnections.sendTo(socket, generation, error, strlen(error));
     }
 }
 
@@ -219,46 +863,212 @@ private:
     int port = 12342; // Port number the server will listen on
     sockaddr_in clientAddress; // Information about the client's address
     SocketConnection serverSocket; // Instance of a SocketConnection class for server communication
-    std::vector<std::thread> clientThreads; // Vector to hold threads for handling client communication
+    TimerWheel heartbeatWheel; // Idle, heartbeat and handshake timers for every connection
+    std::thread heartbeatThread; // Advances heartbeatWheel once per second
+    std::mutex heartbeatMutex;
+    std::condition_variable heartbeatCondition;
+    bool stopHeartbeats = false; // Set by the destructor to end heartbeatThread
+    struct DueTimer {
+        int clientSocket;
+        uint32_t generation; // Guards against the fd being closed and reused before it is handled
+        bool joined;
+    };
+    std::vector<DueTimer> dueTimers; // Expired in the current tick; only touched by heartbeatThread
     std::vector<std::unique_ptr<ChatRoom>> chatRooms; // Vector to hold unique pointers to ChatRoom objects
     std::mutex chatRoomsMutex; // Mutex to synchronize access to the chatRooms vector
-    std::string directoryForCopy; // Directory path for file copying
+    std::string directoryForCopy; // Directory path for file copying; only touched on fileWorker
     std::mutex mutex; // Mutex for general synchronization purposes
+    int epollFd = -1; // The event loop's epoll instance, once listenSocket() has created it
+    bool acceptPaused = false; // Listening socket left out of epoll because descriptors ran out
+    size_t acceptPauses = 0; // Pauses since the last warning
+    std::chrono::steady_clock::time_point lastAcceptWarning;
+    FileWorker fileWorker; // Declared last: destroyed first, so its queued tasks still find the rooms
+
+    static constexpr uint32_t heartbeatTicks = 30; // Idle seconds before a heartbeat is sent
+    static constexpr uint32_t handshakeTicks = 60; // Seconds a new connection has to send its name and room
+    static constexpr int ackTimeoutMs = 20000; // Unacknowledged heartbeat older than this marks the peer dead
+    static constexpr char heartbeatFrame = '\x05'; // Clients drop this byte from everything they display
+    static constexpr int maxEvents = 256; // Readiness events handled per epoll_wait call
 
     void listenSocket(){ // Method to listen for incoming client connections
         if (serverSocket.listenConnection() == -1) { // Attempt to listen on the specified port
             std::cerr << "Failed to listen on port " << port << ". Exiting..." << std::endl; // Print error message if listening fails
             return;
-        } else {
-            std::cout << "Server listening on port " << port << std::endl; // Print message indicating successful listening
+        }
+        std::cout << "Server listening on port " << port << std::endl; // Print message indicating successful listening
 
-            while (true) { // Infinite loop to continuously accept client connections
+        epollFd = epoll_create1(EPOLL_CLOEXEC); // One event loop serves every client connection
+        if (epollFd == -1) {
+            serverSocket.reportError("Creating epoll instance failed");
+            return;
+        }
+        clientConnections.attach(epollFd);
+
+        int listeningSocket = serverSocket.getSocket();
+        struct epoll_event listenEvent{};
+        listenEvent.events = EPOLLIN;
+        listenEvent.data.fd = listeningSocket;
+        if (!serverSocket.setNonBlocking(listeningSocket) || epoll_ctl(epollFd, EPOLL_CTL_ADD, listeningSocket, &listenEvent) == -1) {
+            serverSocket.reportError("Watching the server socket failed");
+            close(epollFd);
+            return;
+        }
+
+        struct epoll_event events[maxEvents];
+        while (true) { // Infinite loop to continuously serve client connections
+            int ready = epoll_wait(epollFd, events, maxEvents, -1);
+            if (ready == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                serverSocket.reportError("Waiting for socket events failed");
+                break;
+            }
 
-                int clientSocket = serverSocket.acceptConnection(clientAddress); // Accept incoming client connection
-                if (clientSocket == -1) { // Check if the client connection was unsuccessful
+            for (int i = 0; i < ready; ++i) {
+                int socket = events[i].data.fd;
+                if (socket == listeningSocket) {
+                    acceptClients();
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT && clientConnections.flush(socket)) { // Hand queued output to the kernel and return its buffers
+                    resumeReplay(socket);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    handleCommunication(socket);
+                }
+            }
+        }
+        close(epollFd);
+    }
+
+    void acceptClients() {
+        while (true) { // Accept everything that is queued; the listening socket is non-blocking
+            int clientSocket = serverSocket.acceptConnection(clientAddress); // Accept incoming client connection
+            if (clientSocket == -1) { // Check if the client connection was unsuccessful
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno == EMFILE || errno == ENFILE) {
+                    pauseAccepting();
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
                     serverSocket.reportError("Error accepting client connection"); // Print error message if accepting connection fails
-                    break; // Exit the loop if there is an error
                 }
+                return;
+            }
 
-                std::cout << "Accepted connection from " << inet_ntoa(clientAddress.sin_addr) << ":" << ntohs(clientAddress.sin_port) << std::endl; // Print client connection details
+            std::cout << "Accepted connection from " << inet_ntoa(clientAddress.sin_addr) << ":" << ntohs(clientAddress.sin_port) << std::endl; // Print client connection details
 
-                clientThreads.emplace_back(&ChatServer::handleCommunication, this, clientSocket); // Start a new thread to handle client communication
+            Connection* connection = clientConnections.open(clientSocket);
+            if (connection == nullptr || !serverSocket.setNonBlocking(clientSocket)) {
+                std::cerr << "Rejecting client " << clientSocket << std::endl;
+                if (connection != nullptr) {
+                    clientConnections.release(clientSocket);
+                }
+                close(clientSocket);
+                continue;
+            }
+            serverSocket.setClientTimeouts(clientSocket, ackTimeoutMs); // Let the kernel notice peers that vanished without a FIN
+
+            struct epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = clientSocket;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &event) == -1) {
+                serverSocket.reportError("Watching client socket failed");
+                clientConnections.release(clientSocket);
+                close(clientSocket);
+                continue;
             }
+            heartbeatWheel.schedule(*connection, handshakeTicks);
+        }
+    }
+
+    // Out of descriptors. The pending connection stays queued and the listening socket stays
+    // readable, so it leaves epoll until closeClient frees a descriptor; otherwise the loop
+    // would spin on accept. Warns at most every 10 seconds.
+    void pauseAccepting() {
+        int error = errno;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, serverSocket.getSocket(), nullptr);
+        acceptPaused = true;
+        ++acceptPauses;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastAcceptWarning >= std::chrono::seconds(10)) {
+            std::cerr << "Accepting paused until a client disconnects: " << strerror(error) << " (" << acceptPauses << " pauses since the last warning)" << std::endl;
+            lastAcceptWarning = now;
+            acceptPauses = 0;
+        }
+    }
+
+    void resumeAccepting() {
+        struct epoll_event listenEvent{};
+        listenEvent.events = EPOLLIN;
+        listenEvent.data.fd = serverSocket.getSocket();
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocket.getSocket(), &listenEvent) == -1) {
+            serverSocket.reportError("Watching the server socket failed");
+            return;
         }
+        acceptPaused = false;
     }
 
 public:
-    ChatServer() : serverSocket(port) { // Constructor for ChatServer class, initializes the server socket and starts listening for connections
-        listenSocket(); // Start listening for incoming connections
+    ChatServer() : serverSocket(port), heartbeatWheel([this](TimerNode& node) { return onHeartbeatTimer(node); }) { // Constructor for ChatServer class, initializes the server socket
     }
 
-    ~ChatServer() { // Destructor for ChatServer class, closes server socket and joins client threads
+    ~ChatServer() { // Destructor for ChatServer class, closes server socket
         serverSocket.closeConnection(); // Close the server socket
-        for (auto& thread : clientThreads) { // Iterate through client threads
-            thread.join(); // Join each client thread
+        {
+            std::lock_guard<std::mutex> lock(heartbeatMutex);
+            stopHeartbeats = true;
+        }
+        heartbeatCondition.notify_one();
+        if (heartbeatThread.joinable()) {
+            heartbeatThread.join();
+        }
+    }
+
+    void run() { // Serves clients until the event loop fails
+        heartbeatThread = std::thread(&ChatServer::runHeartbeats, this); // Start ticking connection timers
+        listenSocket(); // Start listening for incoming connections
+    }
+
+    void runHeartbeats() {
+        auto nextTick = std::chrono::steady_clock::now();
+        while (true) {
+            nextTick += std::chrono::seconds(1);
+            {
+                std::unique_lock<std::mutex> lock(heartbeatMutex);
+                if (heartbeatCondition.wait_until(lock, nextTick, [this] { return stopHeartbeats; })) {
+                    return;
+                }
+            }
+            heartbeatWheel.tick();
+
+            // The wheel is unlocked again, so the event loop can schedule and cancel timers
+            // while a burst of heartbeats goes out. The frame goes through sendTo so it queues
+            // behind pending output instead of landing mid-message; a failed send drops the
+            // client and the event loop reaps it.
+            for (const DueTimer& due : dueTimers) {
+                if (due.joined) {
+                    clientConnections.sendTo(due.clientSocket, due.generation, &heartbeatFrame, 1);
+                } else {
+                    clientConnections.drop(due.clientSocket, due.generation, "did not finish the handshake in time");
+                }
+            }
+            dueTimers.clear();
         }
     }
 
+    // Runs on the heartbeat thread with the wheel locked, so it only notes what runHeartbeats
+    // has to do once the tick is over. The connection cannot be released meanwhile: closeClient
+    // cancels its timer, under the same lock, first.
+    uint32_t onHeartbeatTimer(TimerNode& node) {
+        auto& connection = static_cast<Connection&>(node);
+        bool joined = connection.joined;
+        dueTimers.push_back(DueTimer{connection.clientSocket, connection.generation, joined});
+        return joined ? heartbeatTicks : 0;
+    }
+
 
     void createClientDirectory(const std::string& clientFolderPath) {
         if (!std::filesystem::exists(clientFolderPath)) {
@@ -280,10 +1090,14 @@ public:
         }
     }
 
-    void setDirectories(const std::string& clientName, std::string& clientFolderPath, std::string& serverFolderPath) {
+    static void getFolderPaths(const std::string& clientName, std::string& clientFolderPath, std::string& serverFolderPath) {
         std::string baseFoldersPath = "./chat_app/chatapp_/";
         clientFolderPath = baseFoldersPath + clientName;
         serverFolderPath = baseFoldersPath + "server" + clientName.substr(1);
+    }
+
+    void setDirectories(const std::string& clientName, std::string& clientFolderPath, std::string& serverFolderPath) {
+        getFolderPaths(clientName, clientFolderPath, serverFolderPath);
 
         std::lock_guard<std::mutex> lock(mutex);
 
@@ -291,40 +1105,11 @@ public:
         createServerDirectory(serverFolderPath);
     }
 
-    std::string readSocketString(int clientSocket) {
-        char buffer[1024];
-        memset(buffer, 0, sizeof(buffer));
-        ssize_t bytesRead = recv(clientSocket, buffer, sizeof(buffer), 0);
-        if (bytesRead <= 0) {
-            std::cerr << "Failed to read from socket.\n";
-            close(clientSocket);
-            return "";
-        }
-        return std::string(buffer, bytesRead);
-    }
-
-
-    std::string readClientName(int clientSocket) {
-        return readSocketString(clientSocket);
-    }
-
-
-    std::string readRoomName(int clientSocket) {
-        return readSocketString(clientSocket);
-    }
-
 
     void printClientRoomInfo(const std::string& clientName, const std::string& roomName) {
         std::cout << "Client " << clientName << " joined room: " << roomName << std::endl;
     }
 
-
-    void getClientNameAndRoom(int clientSocket, std::string& clientName, std::string& roomName){
-        clientName = readClientName(clientSocket);
-        roomName = readRoomName(clientSocket);
-        printClientRoomInfo(clientName, roomName);
-    }
-
     ChatRoom* findOrCreateRoom(const std::string& roomName) {
         std::lock_guard<std::mutex> lock(chatRoomsMutex);
         for (auto& room : chatRooms) {
@@ -336,97 +1121,184 @@ public:
         return chatRooms.back().get();
     }
 
+    // "REJOIN <id>" carries the last messageId the client saw; plain "REJOIN" returns -1, as does
+    // INT_MAX, since joinClient resumes from id + 1.
+    static int parseLastSeenId(const std::string& content) {
+        if (content.length() <= 7) {
+            return -1;
+        }
+        char* end = nullptr;
+        long id = strtol(content.c_str() + 7, &end, 10);
+        if (end == content.c_str() + 7 || id < 0 || id >= INT_MAX) {
+            return -1;
+        }
+        return static_cast<int>(id);
+    }
 
 
 
-    void handleCommunication(int clientSocket) {
-        std::string roomName;
-        std::string clientName;
-        getClientNameAndRoom(clientSocket, clientName, roomName);
 
-        std::string clientFolderPath;
-        std::string serverFolderPath;
-        setDirectories(clientName, clientFolderPath, serverFolderPath);
+    // Completes the name/room handshake, either for a new connection or after REJOIN.
+    void joinRoom(Connection& connection, const std::string& roomName) {
+        printClientRoomInfo(connection.clientName, roomName);
 
-        ChatRoom *room = findOrCreateRoom(roomName);
-        room->addClient(clientSocket);
-        std::string pathToFile;
-        std::string pathToCopiedFile;
-        bool rejoin = false;
+        fileWorker.post([this, clientName = connection.clientName] {
+            std::string clientFolderPath;
+            std::string serverFolderPath;
+            setDirectories(clientName, clientFolderPath, serverFolderPath);
+        });
 
-        while (true) {
-            if (rejoin) {
-                getClientNameAndRoom(clientSocket, clientName, roomName);
-                room = findOrCreateRoom(roomName);
-                room->addClient(clientSocket);
-                rejoin = false;
+        ChatRoom* room = findOrCreateRoom(roomName);
+        int lastSeenId = room == connection.room ? connection.lastSeenId : -1; // Ids are only meaningful within one room
+        connection.room = room;
+        connection.room->joinClient(connection.clientSocket, connection.clientName, lastSeenId);
+        connection.lastSeenId = -1;
+        connection.state = ConnectionState::InRoom;
+        connection.joined = true; // Atomic: the heartbeat thread may be expiring this connection's handshake timer right now
+        heartbeatWheel.schedule(connection, heartbeatTicks);
+    }
 
-            } else {
-                char buffer[1024];
-                memset(buffer, 0, sizeof(buffer));
-                ssize_t receivedBytes = serverSocket.receiveData(clientSocket, buffer, sizeof(buffer), 0);
-                if (receivedBytes > 0) {
-                    std::string content(buffer, receivedBytes);
-                    if (content == "REJOIN") {
-                        room->removeClient(clientSocket);
+    // A room replay that stopped because the socket backed up goes on once it has drained.
+    void resumeReplay(int clientSocket) {
+        Connection& connection = clientConnections.at(clientSocket);
+        if (connection.state == ConnectionState::InRoom) {
+            connection.room->resumeReplay(clientSocket, connection.clientName);
+        }
+    }
 
-                        std::cout << "Client " << clientSocket << " has left room " << roomName << ". And will rejoin to another." << std::endl;
+    void closeClient(Connection& connection) {
+        int clientSocket = connection.clientSocket;
+        heartbeatWheel.cancel(connection); // Must precede close() so the wheel never touches a reused fd
+        if (connection.room != nullptr) {
+            connection.room->removeClient(clientSocket, connection.clientName);
+        }
+        clientConnections.release(clientSocket);
+        close(clientSocket);
+        if (acceptPaused) {
+            resumeAccepting();
+        }
+    }
 
-                        rejoin = true;
+    void processCommand(Connection& connection, const std::string& content) {
+        int clientSocket = connection.clientSocket;
+        ChatRoom *room = connection.room;
+        const std::string& clientName = connection.clientName;
 
+        std::string clientFolderPath;
+        std::string serverFolderPath;
+        getFolderPaths(clientName, clientFolderPath, serverFolderPath);
+        std::string pathToFile;
+        std::string pathToCopiedFile;
+        uint32_t generation = connection.generation; // File work finishes later, maybe after this client has gone
 
-                    } else if (content.find("YES ") == 0) {
-                        std::string filename = content.substr(4);
+        if (content == "REJOIN" || content.find("REJOIN ") == 0) {
+            room->removeClient(clientSocket, clientName);
+            connection.lastSeenId = parseLastSeenId(content);
+            connection.state = ConnectionState::AwaitName;
 
+            std::cout << "Client " << clientSocket << " has left room " << room->getName() << ". And will rejoin to another." << std::endl;
 
-                        pathToFile = directoryForCopy;
-                        pathToCopiedFile = clientFolderPath + "/" + filename;
 
-                        FileManager::copyFile(pathToFile, pathToCopiedFile, clientSocket);
-                    } else if (content.find("NO ") == 0) {
-                        std::string filename = content.substr(3);
+        } else if (content.find("YES ") == 0) {
+            std::string filename = content.substr(4);
 
 
-                        pathToFile = serverFolderPath + "/" + filename;
+            pathToCopiedFile = clientFolderPath + "/" + filename;
 
+            fileWorker.post([this, pathToCopiedFile, clientSocket, generation] {
+                FileManager::copyFile(directoryForCopy, pathToCopiedFile, clientSocket, generation);
+            });
+        } else if (content.find("NO ") == 0) {
+            std::string filename = content.substr(3);
 
-                        std::filesystem::remove(pathToFile);
-                    } else if (content.find("SEND ") == 0) {
-                        std::string filename = content.substr(5);
 
-                        pathToFile = clientFolderPath + "/" + filename;
-                        pathToCopiedFile = serverFolderPath + "/" + filename;
+            pathToFile = serverFolderPath + "/" + filename;
 
 
-                        FileManager::copyFile(pathToFile, pathToCopiedFile, clientSocket);
+            fileWorker.post([pathToFile] {
+                std::error_code error;
+                std::filesystem::remove(pathToFile, error);
+            });
+        } else if (content.find("SEND ") == 0) {
+            std::string filename = content.substr(5);
 
+            pathToFile = clientFolderPath + "/" + filename;
+            pathToCopiedFile = serverFolderPath + "/" + filename;
 
-                        directoryForCopy = pathToCopiedFile;
 
+            ChatMessage message{content, clientName, filename, clientSocket};
+            fileWorker.post([this, pathToFile, pathToCopiedFile, clientSocket, generation, room, message] {
+                FileManager::copyFile(pathToFile, pathToCopiedFile, clientSocket, generation);
+                directoryForCopy = pathToCopiedFile;
+                room->addMessageToQueue(message); // The offer goes out once the file is in place
+            });
+        } else if (content == "EXIT") {
+            room->removeClient(clientSocket, clientName);
 
-                        ChatMessage message{content, clientName, filename, clientSocket, room->nextMessageId++};
-                        room->addMessageToQueue(message);
-                    } else if (content == "EXIT") {
-                        room->removeClient(clientSocket);
+            std::cout << "Client " << clientSocket << " has left room " << room->getName() << std::endl;
+        } else {
+            ChatMessage message{content, clientName, " ", clientSocket};
+            room->addMessageToQueue(message);
+        }
+    }
 
-                        std::cout << "Client " << clientSocket << " has left room " << roomName << std::endl;
-                    } else {
-                        ChatMessage message{content, clientName, " ", clientSocket, room->nextMessageId++};
-                        room->addMessageToQueue(message);
-                    }
-                } else {
-                    std::cerr << "Received failed: " << strerror(errno) << std::endl;
-                    break;
-                }
+    // Handles one readiness event for a client. The receive buffer is borrowed from the shared
+    // pool just for this call, so a connection between messages owns nothing but its Connection slot.
+    void handleCommunication(int clientSocket) {
+        Connection& connection = clientConnections.at(clientSocket);
+        if (connection.state == ConnectionState::Free) {
+            return; // Stale event for a connection closed earlier in this batch
+        }
+
+        BufferPool::Buffer* buffer = clientConnections.buffers().acquire();
+        ssize_t receivedBytes = serverSocket.receiveData(clientSocket, buffer->data, BufferPool::bufferSize, MSG_DONTWAIT);
+        if (receivedBytes <= 0) {
+            clientConnections.buffers().release(buffer);
+            if (receivedBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                return;
+            }
+            if (receivedBytes == 0) {
+                std::cout << "Client " << clientSocket << " closed the connection" << std::endl;
+            } else {
+                std::cerr << "Received failed: " << strerror(errno) << std::endl;
             }
+            closeClient(connection);
+            return;
         }
+        std::string content(buffer->data, receivedBytes);
+        clientConnections.buffers().release(buffer);
 
-        room->removeClient(clientSocket);
-        close(clientSocket);
+        switch (connection.state) {
+            case ConnectionState::AwaitName:
+                connection.clientName = content;
+                connection.state = ConnectionState::AwaitRoom;
+                break;
+            case ConnectionState::AwaitRoom:
+                joinRoom(connection, content);
+                break;
+            case ConnectionState::InRoom:
+                heartbeatWheel.schedule(connection, heartbeatTicks); // Any traffic proves the peer is alive
+                processCommand(connection, content);
+                break;
+            case ConnectionState::Free:
+                break;
+        }
     }
 };
 
+// microbench.cpp includes this file to reach the server internals and supplies its own main.
+#ifndef CHAT_SERVER_NO_MAIN
 int main() {
+    signal(SIGPIPE, SIG_IGN); // Writes to vanished peers report EPIPE instead of killing the server
+
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+        fileLimit.rlim_cur = fileLimit.rlim_max; // Every idle client holds a descriptor
+        setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+
     ChatServer newChatServer;
+    newChatServer.run();
     return 0;
 }
+#endif